@@ -1,4 +1,11 @@
 #include "file_client.h"
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+// Keep each delta message comfortably under gRPC's default 4 MB limit.
+constexpr size_t kMaxDeltaBatchBytes = 1024 * 1024;
+constexpr int kMaxDeltaBatchInstructions = 4096;
 
 FileClient::FileClient(std::shared_ptr<Channel> channel)
     : stub_(FileService::NewStub(channel)) {}
@@ -148,6 +155,128 @@ void FileClient::GetFileInfo(const std::string& filename) {
     }
 }
 
+bool FileClient::SyncFile(const std::string& local_path, const std::string& filename) {
+    std::ifstream input(local_path, std::ios::binary);
+    if (!input.is_open()) {
+        std::cout << "SyncFile failed: cannot open " << local_path << std::endl;
+        return false;
+    }
+
+    // Fetch block signatures for the server's current copy.
+    filemanagement::GetFileSignatureRequest signature_request;
+    filemanagement::GetFileSignatureResponse signature_response;
+    filemanagement::SignatureHeader header;
+    std::vector<deltasync::BlockSignature> signatures;
+    ClientContext signature_context;
+
+    signature_request.set_filename(filename);
+
+    auto reader = stub_->GetFileSignature(&signature_context, signature_request);
+    while (reader->Read(&signature_response)) {
+        if (signature_response.has_header()) {
+            header = signature_response.header();
+            continue;
+        }
+        for (const auto& block : signature_response.signatures().blocks()) {
+            signatures.push_back({block.weak_checksum(), block.strong_checksum()});
+        }
+    }
+
+    Status status = reader->Finish();
+    if (!status.ok()) {
+        std::cout << "SyncFile failed: " << status.error_message() << std::endl;
+        return false;
+    }
+    if (!header.success()) {
+        std::cout << "SyncFile: " << header.message() << std::endl;
+        return false;
+    }
+
+    // Stream copy/literal instructions back; the server applies them to a
+    // temp file and only replaces the original once the checksum matches.
+    filemanagement::ApplyFileDeltaRequest message;
+    filemanagement::ApplyFileDeltaResponse response;
+    ClientContext context;
+
+    auto writer = stub_->ApplyFileDelta(&context, &response);
+
+    auto delta_header = message.mutable_header();
+    delta_header->set_filename(filename);
+    delta_header->set_block_size(header.block_size());
+    delta_header->set_base_file_size(header.file_size());
+
+    size_t batch_bytes = 0;
+    bool stream_closed = false;
+    auto send = [&]() {
+        if (!writer->Write(message)) {
+            stream_closed = true;
+            throw std::runtime_error("server closed the delta stream");
+        }
+        message.Clear();
+        batch_bytes = 0;
+    };
+
+    deltasync::DeltaStats stats;
+    try {
+        send();
+
+        stats = deltasync::GenerateDelta(input, header.block_size(), header.file_size(), signatures,
+            [&](deltasync::DeltaOp&& op) {
+                auto instruction = message.mutable_instructions()->add_instructions();
+                if (op.kind == deltasync::DeltaOp::Kind::kCopy) {
+                    instruction->mutable_copy()->set_first_block(op.first_block);
+                    instruction->mutable_copy()->set_block_count(op.block_count);
+                    batch_bytes += sizeof(op.first_block) + sizeof(op.block_count);
+                } else {
+                    batch_bytes += op.literal.size();
+                    instruction->set_literal(std::move(op.literal));
+                }
+
+                if (batch_bytes >= kMaxDeltaBatchBytes ||
+                    message.instructions().instructions_size() >= kMaxDeltaBatchInstructions) {
+                    send();
+                }
+            });
+
+        if (message.has_instructions()) {
+            send();
+        }
+
+        auto trailer = message.mutable_trailer();
+        trailer->set_file_size(static_cast<int64_t>(stats.file_size));
+        trailer->set_sha256(stats.sha256);
+        send();
+        writer->WritesDone();
+    } catch (const std::exception& e) {
+        // If the server hung up early its status (or, if OK, its response)
+        // explains why; otherwise the failure was local and the half-sent
+        // delta must be abandoned.
+        if (!stream_closed) {
+            context.TryCancel();
+        }
+        status = writer->Finish();
+        if (!stream_closed) {
+            std::cout << "SyncFile failed: " << e.what() << std::endl;
+        } else if (!status.ok()) {
+            std::cout << "SyncFile failed: " << status.error_message() << std::endl;
+        } else {
+            std::cout << "SyncFile failed: " << response.message() << std::endl;
+        }
+        return false;
+    }
+
+    status = writer->Finish();
+
+    if (status.ok()) {
+        std::cout << "SyncFile: " << response.message() << " (" << stats.literal_bytes
+                  << " bytes sent, " << stats.copied_bytes << " bytes reused)" << std::endl;
+        return response.success();
+    } else {
+        std::cout << "SyncFile failed: " << status.error_message() << std::endl;
+        return false;
+    }
+}
+
 void RunInteractiveClient(FileClient& client) {
     std::string server_address = "localhost:50051";
     // FileClient client(grpc::CreateChannel(server_address, grpc::InsecureChannelCredentials()));
@@ -162,7 +291,8 @@ void RunInteractiveClient(FileClient& client) {
     std::cout << "5. list [directory]" << std::endl;
     std::cout << "6. mkdir <directory>" << std::endl;
     std::cout << "7. info <filename>" << std::endl;
-    std::cout << "8. exit" << std::endl;
+    std::cout << "8. sync <local_path> <filename>" << std::endl;
+    std::cout << "9. exit" << std::endl;
     std::cout << "===============================" << std::endl;
 
     std::string command;
@@ -223,6 +353,13 @@ void RunInteractiveClient(FileClient& client) {
             std::string filename;
             iss >> filename;
             client.GetFileInfo(filename);
+        } else if (cmd == "sync") {
+            std::string local_path, filename;
+            iss >> local_path >> filename;
+            if (filename.empty()) {
+                filename = std::filesystem::path(local_path).filename().string();
+            }
+            client.SyncFile(local_path, filename);
         } else {
             std::cout << "Unknown command: " << cmd << std::endl;
         }
@@ -3,6 +3,7 @@
 
 #include <grpcpp/grpcpp.h>
 #include "file_service.grpc.pb.h"
+#include "delta_sync.h"
 #include <memory>
 #include <string>
 #include <iostream>
@@ -25,6 +26,7 @@ public:
     void ListFiles(const std::string& directory = "");
     bool CreateDirectory(const std::string& directory);
     void GetFileInfo(const std::string& filename);
+    bool SyncFile(const std::string& local_path, const std::string& filename);
 
 private:
     std::unique_ptr<FileService::Stub> stub_;
@@ -0,0 +1,470 @@
+#include "delta_sync.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+namespace deltasync {
+
+void RollingChecksum::Reset(const char* data, size_t length) {
+    a_ = 0;
+    b_ = 0;
+    length_ = static_cast<uint32_t>(length);
+    for (size_t i = 0; i < length; ++i) {
+        a_ += static_cast<unsigned char>(data[i]);
+        b_ += static_cast<uint32_t>(length - i) * static_cast<unsigned char>(data[i]);
+    }
+}
+
+void RollingChecksum::Roll(unsigned char out, unsigned char in) {
+    a_ = a_ - out + in;
+    b_ = b_ - length_ * out + a_;
+}
+
+namespace {
+
+const uint32_t kSha256RoundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+inline uint32_t RotateRight(uint32_t value, int bits) {
+    return (value >> bits) | (value << (32 - bits));
+}
+
+}  // namespace
+
+Sha256::Sha256()
+    : state_{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+             0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19} {}
+
+void Sha256::Transform(const unsigned char* chunk) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i) {
+        w[i] = (static_cast<uint32_t>(chunk[i * 4]) << 24) |
+               (static_cast<uint32_t>(chunk[i * 4 + 1]) << 16) |
+               (static_cast<uint32_t>(chunk[i * 4 + 2]) << 8) |
+               static_cast<uint32_t>(chunk[i * 4 + 3]);
+    }
+    for (int i = 16; i < 64; ++i) {
+        uint32_t s0 = RotateRight(w[i - 15], 7) ^ RotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = RotateRight(w[i - 2], 17) ^ RotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+    uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+    for (int i = 0; i < 64; ++i) {
+        uint32_t s1 = RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + kSha256RoundConstants[i] + w[i];
+        uint32_t s0 = RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state_[0] += a; state_[1] += b; state_[2] += c; state_[3] += d;
+    state_[4] += e; state_[5] += f; state_[6] += g; state_[7] += h;
+}
+
+void Sha256::Update(const void* data, size_t length) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    total_length_ += length;
+
+    if (buffer_length_ > 0) {
+        size_t take = std::min(length, sizeof(buffer_) - buffer_length_);
+        std::memcpy(buffer_ + buffer_length_, bytes, take);
+        buffer_length_ += take;
+        bytes += take;
+        length -= take;
+        if (buffer_length_ < sizeof(buffer_)) {
+            return;
+        }
+        Transform(buffer_);
+        buffer_length_ = 0;
+    }
+
+    while (length >= sizeof(buffer_)) {
+        Transform(bytes);
+        bytes += sizeof(buffer_);
+        length -= sizeof(buffer_);
+    }
+
+    std::memcpy(buffer_, bytes, length);
+    buffer_length_ = length;
+}
+
+std::string Sha256::Final() {
+    const uint64_t bit_length = total_length_ * 8;
+
+    unsigned char padding[72] = {0x80};
+    size_t pad_length = (buffer_length_ < 56) ? (56 - buffer_length_) : (120 - buffer_length_);
+    for (int i = 0; i < 8; ++i) {
+        padding[pad_length + i] = static_cast<unsigned char>(bit_length >> (56 - i * 8));
+    }
+    Update(padding, pad_length + 8);
+
+    std::string digest(kStrongHashSize, '\0');
+    for (int i = 0; i < 8; ++i) {
+        digest[i * 4] = static_cast<char>(state_[i] >> 24);
+        digest[i * 4 + 1] = static_cast<char>(state_[i] >> 16);
+        digest[i * 4 + 2] = static_cast<char>(state_[i] >> 8);
+        digest[i * 4 + 3] = static_cast<char>(state_[i]);
+    }
+    return digest;
+}
+
+std::string Sha256::Hash(const void* data, size_t length) {
+    Sha256 sha;
+    sha.Update(data, length);
+    return sha.Final();
+}
+
+uint32_t ChooseBlockSize(uint64_t file_size) {
+    uint64_t block_size = static_cast<uint64_t>(std::sqrt(static_cast<double>(file_size)));
+    block_size = (block_size + 1023) & ~static_cast<uint64_t>(1023);
+    return static_cast<uint32_t>(std::clamp<uint64_t>(block_size, kMinBlockSize, kMaxBlockSize));
+}
+
+std::vector<BlockSignature> ComputeSignatures(const std::string& path, uint64_t file_size,
+                                              uint32_t block_size, unsigned max_threads) {
+    if (block_size == 0) {
+        throw std::invalid_argument("Block size must be positive");
+    }
+
+    const uint64_t block_count = (file_size + block_size - 1) / block_size;
+    std::vector<BlockSignature> signatures(block_count);
+    if (block_count == 0) {
+        return signatures;
+    }
+
+    // Hashing is CPU bound, but a thread per core only pays off once each
+    // one has a decent amount of data to chew through.
+    const uint64_t min_blocks_per_thread = std::max<uint64_t>(1, (8ull << 20) / block_size);
+    uint64_t thread_count = max_threads ? max_threads : std::thread::hardware_concurrency();
+    thread_count = std::min(thread_count,
+                            (block_count + min_blocks_per_thread - 1) / min_blocks_per_thread);
+    thread_count = std::max<uint64_t>(thread_count, 1);
+
+    auto hash_range = [&](uint64_t begin, uint64_t end) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            throw std::runtime_error("Failed to open " + path);
+        }
+        file.seekg(static_cast<std::streamoff>(begin * block_size));
+
+        std::vector<char> block(block_size);
+        RollingChecksum rolling;
+        for (uint64_t i = begin; i < end; ++i) {
+            size_t length = static_cast<size_t>(
+                std::min<uint64_t>(block_size, file_size - i * block_size));
+            file.read(block.data(), static_cast<std::streamsize>(length));
+            if (static_cast<size_t>(file.gcount()) != length) {
+                throw std::runtime_error("Short read on " + path);
+            }
+            rolling.Reset(block.data(), length);
+            signatures[i].weak = rolling.Digest();
+            signatures[i].strong = Sha256::Hash(block.data(), length);
+        }
+    };
+
+    if (thread_count == 1) {
+        hash_range(0, block_count);
+        return signatures;
+    }
+
+    std::vector<std::thread> workers;
+    std::vector<std::exception_ptr> errors(thread_count);
+    const uint64_t per_thread = (block_count + thread_count - 1) / thread_count;
+    for (uint64_t t = 0; t < thread_count; ++t) {
+        uint64_t begin = t * per_thread;
+        uint64_t end = std::min(block_count, begin + per_thread);
+        if (begin >= end) {
+            break;
+        }
+        workers.emplace_back([&, t, begin, end]() {
+            try {
+                hash_range(begin, end);
+            } catch (...) {
+                errors[t] = std::current_exception();
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    for (const auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+    return signatures;
+}
+
+DeltaStats GenerateDelta(std::istream& input, uint32_t block_size, uint64_t base_size,
+                         const std::vector<BlockSignature>& signatures,
+                         const std::function<void(DeltaOp&&)>& emit,
+                         size_t max_literal) {
+    DeltaStats stats;
+    Sha256 file_sha;
+
+    const uint64_t full_blocks = block_size ? base_size / block_size : 0;
+    const size_t tail_length = block_size ? static_cast<size_t>(base_size % block_size) : 0;
+    const bool has_tail = tail_length > 0 && signatures.size() > full_blocks;
+
+    // Only full-size blocks can match a sliding window; the short trailing
+    // block is checked once against the end of the input.
+    std::unordered_map<uint32_t, std::vector<uint64_t>> index;
+    index.reserve(static_cast<size_t>(std::min<uint64_t>(full_blocks, signatures.size())));
+    for (uint64_t i = 0; i < full_blocks && i < signatures.size(); ++i) {
+        index[signatures[i].weak].push_back(i);
+    }
+
+    DeltaOp pending_copy;
+    bool has_pending_copy = false;
+
+    auto flush_copy = [&]() {
+        if (has_pending_copy) {
+            emit(std::move(pending_copy));
+            has_pending_copy = false;
+        }
+    };
+
+    auto add_copy = [&](uint64_t block) {
+        if (has_pending_copy &&
+            pending_copy.first_block + pending_copy.block_count == block) {
+            ++pending_copy.block_count;
+            return;
+        }
+        flush_copy();
+        pending_copy = DeltaOp{};
+        pending_copy.kind = DeltaOp::Kind::kCopy;
+        pending_copy.first_block = block;
+        pending_copy.block_count = 1;
+        has_pending_copy = true;
+    };
+
+    auto add_literal = [&](const char* data, size_t length) {
+        while (length > 0) {
+            flush_copy();
+            size_t take = std::min(length, max_literal);
+            DeltaOp op;
+            op.kind = DeltaOp::Kind::kLiteral;
+            op.literal.assign(data, take);
+            stats.literal_bytes += take;
+            emit(std::move(op));
+            data += take;
+            length -= take;
+        }
+    };
+
+    // buffer_[literal_start, pos) holds unmatched bytes not yet emitted and
+    // buffer_[pos, pos + block_size) is the current window.
+    const size_t read_size = std::max<size_t>(static_cast<size_t>(block_size) * 4, 1 << 20);
+    std::vector<char> buffer;
+    size_t length = 0;
+    size_t pos = 0;
+    size_t literal_start = 0;
+    bool eof = false;
+
+    auto fill = [&]() {
+        add_literal(buffer.data() + literal_start, pos - literal_start);
+        buffer.erase(buffer.begin(), buffer.begin() + pos);
+        length -= pos;
+        pos = 0;
+        literal_start = 0;
+
+        buffer.resize(length + read_size);
+        input.read(buffer.data() + length, static_cast<std::streamsize>(read_size));
+        if (input.bad()) {
+            throw std::runtime_error("Failed to read input");
+        }
+        size_t got = static_cast<size_t>(input.gcount());
+        file_sha.Update(buffer.data() + length, got);
+        stats.file_size += got;
+        length += got;
+        buffer.resize(length);
+        if (got < read_size) {
+            eof = true;
+        }
+    };
+
+    auto find_block = [&](uint32_t weak) -> int64_t {
+        auto it = index.find(weak);
+        if (it == index.end()) {
+            return -1;
+        }
+        std::string strong = Sha256::Hash(buffer.data() + pos, block_size);
+        int64_t found = -1;
+        for (uint64_t block : it->second) {
+            if (signatures[block].strong != strong) {
+                continue;
+            }
+            // Prefer the block that extends the current copy run.
+            if (has_pending_copy &&
+                block == pending_copy.first_block + pending_copy.block_count) {
+                return static_cast<int64_t>(block);
+            }
+            if (found < 0) {
+                found = static_cast<int64_t>(block);
+            }
+        }
+        return found;
+    };
+
+    if (index.empty()) {
+        while (!eof) {
+            pos = length;
+            fill();
+        }
+    } else {
+        RollingChecksum rolling;
+        bool rolling_valid = false;
+        while (true) {
+            if (length - pos < block_size) {
+                if (eof) {
+                    break;
+                }
+                fill();
+                continue;
+            }
+
+            if (!rolling_valid) {
+                rolling.Reset(buffer.data() + pos, block_size);
+                rolling_valid = true;
+            }
+
+            int64_t block = find_block(rolling.Digest());
+            if (block >= 0) {
+                add_literal(buffer.data() + literal_start, pos - literal_start);
+                add_copy(static_cast<uint64_t>(block));
+                stats.copied_bytes += block_size;
+                pos += block_size;
+                literal_start = pos;
+                rolling_valid = false;
+                continue;
+            }
+
+            if (pos + block_size < length) {
+                rolling.Roll(static_cast<unsigned char>(buffer[pos]),
+                             static_cast<unsigned char>(buffer[pos + block_size]));
+                ++pos;
+            } else if (eof) {
+                break;
+            } else {
+                // The window is unchanged by a refill, so the checksum stays valid.
+                fill();
+                continue;
+            }
+
+            if (pos - literal_start >= max_literal) {
+                add_literal(buffer.data() + literal_start, pos - literal_start);
+                literal_start = pos;
+            }
+        }
+
+        if (has_tail && length - literal_start >= tail_length) {
+            const size_t tail_pos = length - tail_length;
+            const BlockSignature& tail = signatures[full_blocks];
+            RollingChecksum tail_checksum;
+            tail_checksum.Reset(buffer.data() + tail_pos, tail_length);
+            if (tail_checksum.Digest() == tail.weak &&
+                Sha256::Hash(buffer.data() + tail_pos, tail_length) == tail.strong) {
+                add_literal(buffer.data() + literal_start, tail_pos - literal_start);
+                add_copy(full_blocks);
+                stats.copied_bytes += tail_length;
+                literal_start = length;
+            }
+        }
+    }
+
+    add_literal(buffer.data() + literal_start, length - literal_start);
+    flush_copy();
+
+    stats.sha256 = file_sha.Final();
+    return stats;
+}
+
+DeltaApplier::DeltaApplier(const std::string& base_path, uint64_t base_size, uint32_t block_size,
+                           const std::string& output_path)
+    : base_path_(base_path), base_size_(base_size), block_size_(block_size),
+      output_(output_path, std::ios::binary | std::ios::trunc) {
+    if (!output_.is_open()) {
+        throw std::runtime_error("Failed to open " + output_path);
+    }
+}
+
+void DeltaApplier::Copy(uint64_t first_block, uint64_t block_count) {
+    const uint64_t total_blocks = block_size_ ? (base_size_ + block_size_ - 1) / block_size_ : 0;
+    if (block_count == 0 || first_block >= total_blocks ||
+        block_count > total_blocks - first_block) {
+        throw std::runtime_error("Delta references a block outside the base file");
+    }
+
+    if (!base_file_) {
+        base_file_ = std::make_unique<std::ifstream>(base_path_, std::ios::binary);
+        if (!base_file_->is_open()) {
+            throw std::runtime_error("Failed to open base file");
+        }
+    }
+
+    const uint64_t offset = first_block * block_size_;
+    uint64_t remaining = std::min(block_count * block_size_, base_size_ - offset);
+    base_file_->clear();
+    base_file_->seekg(static_cast<std::streamoff>(offset));
+
+    char chunk[64 * 1024];
+    while (remaining > 0) {
+        size_t take = static_cast<size_t>(std::min<uint64_t>(remaining, sizeof(chunk)));
+        base_file_->read(chunk, static_cast<std::streamsize>(take));
+        if (static_cast<size_t>(base_file_->gcount()) != take) {
+            throw std::runtime_error("Base file changed during sync");
+        }
+        Write(chunk, take);
+        stats_.copied_bytes += take;
+        remaining -= take;
+    }
+}
+
+void DeltaApplier::Literal(const std::string& data) {
+    Write(data.data(), data.size());
+    stats_.literal_bytes += data.size();
+}
+
+void DeltaApplier::Write(const char* data, size_t length) {
+    output_.write(data, static_cast<std::streamsize>(length));
+    if (!output_) {
+        throw std::runtime_error("Failed to write output file");
+    }
+    sha_.Update(data, length);
+    stats_.file_size += length;
+}
+
+DeltaStats DeltaApplier::Finish() {
+    base_file_.reset();
+    output_.close();
+    if (output_.fail()) {
+        throw std::runtime_error("Failed to flush output file");
+    }
+    stats_.sha256 = sha_.Final();
+    return stats_;
+}
+
+}  // namespace deltasync
@@ -0,0 +1,122 @@
+#ifndef DELTA_SYNC_H
+#define DELTA_SYNC_H
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// rsync-style delta transfer helpers shared by the client and the server.
+//
+// The receiver (server) describes its current copy of a file as a list of
+// fixed-size block signatures. The sender (client) slides a window over the
+// new contents, matching blocks by a cheap rolling checksum and confirming
+// them with a strong hash, and emits copy/literal instructions. The receiver
+// replays those instructions against its old copy to rebuild the new file.
+namespace deltasync {
+
+constexpr uint32_t kMinBlockSize = 2 * 1024;
+constexpr uint32_t kMaxBlockSize = 128 * 1024;
+constexpr size_t kStrongHashSize = 32;
+
+// Adler-32 style rolling checksum, as used by rsync for its weak hash.
+class RollingChecksum {
+public:
+    void Reset(const char* data, size_t length);
+    void Roll(unsigned char out, unsigned char in);
+    uint32_t Digest() const { return (b_ << 16) | (a_ & 0xffff); }
+
+private:
+    uint32_t a_ = 0;
+    uint32_t b_ = 0;
+    uint32_t length_ = 0;
+};
+
+// Incremental SHA-256, used as the strong block hash and whole-file checksum.
+class Sha256 {
+public:
+    Sha256();
+    void Update(const void* data, size_t length);
+    std::string Final();  // 32 raw bytes
+
+    static std::string Hash(const void* data, size_t length);
+
+private:
+    void Transform(const unsigned char* chunk);
+
+    uint32_t state_[8];
+    unsigned char buffer_[64];
+    size_t buffer_length_ = 0;
+    uint64_t total_length_ = 0;
+};
+
+struct BlockSignature {
+    uint32_t weak = 0;
+    std::string strong;
+};
+
+// One delta instruction: either reuse a run of the receiver's blocks, or
+// insert new bytes.
+struct DeltaOp {
+    enum class Kind { kCopy, kLiteral };
+
+    Kind kind = Kind::kLiteral;
+    uint64_t first_block = 0;
+    uint64_t block_count = 0;
+    std::string literal;
+};
+
+struct DeltaStats {
+    uint64_t file_size = 0;
+    uint64_t literal_bytes = 0;
+    uint64_t copied_bytes = 0;
+    std::string sha256;
+};
+
+// Picks a block size of roughly sqrt(file_size), clamped to sane bounds.
+uint32_t ChooseBlockSize(uint64_t file_size);
+
+// Computes block signatures for the first `file_size` bytes of `path`.
+// Blocks are split into contiguous ranges hashed on separate threads, each
+// with its own file handle. Throws std::runtime_error on I/O failure.
+std::vector<BlockSignature> ComputeSignatures(const std::string& path, uint64_t file_size,
+                                              uint32_t block_size, unsigned max_threads = 0);
+
+// Streams `input` against the receiver's signatures and calls `emit` for
+// every instruction in file order. Adjacent copies are merged and literals
+// are split at `max_literal` bytes so each op fits in a single message.
+DeltaStats GenerateDelta(std::istream& input, uint32_t block_size, uint64_t base_size,
+                         const std::vector<BlockSignature>& signatures,
+                         const std::function<void(DeltaOp&&)>& emit,
+                         size_t max_literal = 64 * 1024);
+
+// Rebuilds a file from a base copy plus delta instructions.
+class DeltaApplier {
+public:
+    DeltaApplier(const std::string& base_path, uint64_t base_size, uint32_t block_size,
+                 const std::string& output_path);
+
+    void Copy(uint64_t first_block, uint64_t block_count);
+    void Literal(const std::string& data);
+
+    // Flushes the output and returns its size and SHA-256.
+    DeltaStats Finish();
+
+private:
+    void Write(const char* data, size_t length);
+
+    std::string base_path_;
+    uint64_t base_size_;
+    uint32_t block_size_;
+    std::unique_ptr<std::ifstream> base_file_;
+    std::ofstream output_;
+    Sha256 sha_;
+    DeltaStats stats_;
+};
+
+}  // namespace deltasync
+
+#endif // DELTA_SYNC_H
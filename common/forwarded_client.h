@@ -0,0 +1,24 @@
+#ifndef FORWARDED_CLIENT_H
+#define FORWARDED_CLIENT_H
+
+#include <string>
+
+// How file_router tells the backends who the real client is. Both sides
+// include this so the wire contract can't drift.
+
+// Metadata a trusted forwarder (file_router) uses to name the real client.
+constexpr char kForwardedClientMetadataKey[] = "x-forwarded-for";
+
+// Strips the port from a gRPC peer string: "ipv4:10.0.0.1:54321" ->
+// "ipv4:10.0.0.1", "ipv6:[::1]:54321" -> "ipv6:[::1]". Every connection from
+// the same host maps to the same value.
+inline std::string PeerHost(const std::string& peer) {
+    size_t colon = peer.rfind(':');
+    size_t scheme = peer.find(':');
+    if (colon == std::string::npos || colon == scheme) {
+        return peer;
+    }
+    return peer.substr(0, colon);
+}
+
+#endif // FORWARDED_CLIENT_H
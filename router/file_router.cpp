@@ -0,0 +1,637 @@
+#include "file_router.h"
+#include "forwarded_client.h"
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <filesystem>
+#include <mutex>
+#include <set>
+#include <thread>
+
+// Paths are routed by their normalized form so "a/b.txt", "./a/b.txt" and
+// "a//b.txt" all land on the same shard.
+static std::string RouteKey(const std::string& filename) {
+    std::string key = std::filesystem::path(filename).lexically_normal().generic_string();
+    while (key.rfind("./", 0) == 0) {
+        key.erase(0, 2);
+    }
+    while (!key.empty() && key[0] == '/') {
+        key.erase(0, 1);
+    }
+    return key;
+}
+
+// Backends see the router as their only peer. Pass the real client along so
+// their admission control can still rate-limit per client; file_server only
+// honours this from hosts listed as trusted forwarders.
+static void PrepareBackendContext(ServerContext* context, ClientContext* client_context) {
+    client_context->set_deadline(context->deadline());
+    client_context->AddMetadata(kForwardedClientMetadataKey, PeerHost(context->peer()));
+}
+
+FileRouterImpl::FileRouterImpl(const std::vector<std::string>& backend_addresses, size_t replicas,
+                               std::chrono::milliseconds min_hedge_delay)
+    : replicas_(std::max<size_t>(1, std::min(replicas, backend_addresses.size()))),
+      min_hedge_delay_(min_hedge_delay) {
+    for (const auto& address : backend_addresses) {
+        ring_.AddNode(address);
+        backends_.push_back(FileService::NewStub(
+            grpc::CreateChannel(address, grpc::InsecureChannelCredentials())));
+    }
+}
+
+std::vector<size_t> FileRouterImpl::ReplicasFor(const std::string& filename) const {
+    return ring_.NodesFor(RouteKey(filename), replicas_);
+}
+
+std::vector<size_t> FileRouterImpl::FreshReplicasFor(const std::string& filename) {
+    std::vector<size_t> replicas = ReplicasFor(filename);
+    std::lock_guard<std::mutex> lock(stale_mutex_);
+    auto stale = stale_replicas_.find(RouteKey(filename));
+    if (stale == stale_replicas_.end()) {
+        return replicas;
+    }
+    std::vector<size_t> fresh;
+    for (size_t backend : replicas) {
+        if (stale->second.count(backend) == 0) {
+            fresh.push_back(backend);
+        }
+    }
+    // Some replica always took the latest successful write, but never
+    // hand back an empty list.
+    return fresh.empty() ? replicas : fresh;
+}
+
+bool FileRouterImpl::HasStaleReplicas(const std::string& filename) {
+    std::lock_guard<std::mutex> lock(stale_mutex_);
+    return stale_replicas_.count(RouteKey(filename)) > 0;
+}
+
+void FileRouterImpl::RecordWriteOutcome(const std::string& filename,
+                                        const std::vector<size_t>& replicas,
+                                        const std::vector<bool>& succeeded) {
+    size_t successes = std::count(succeeded.begin(), succeeded.end(), true);
+    if (successes == 0) {
+        // Nothing changed anywhere, so nothing diverged.
+        return;
+    }
+
+    std::string key = RouteKey(filename);
+    std::lock_guard<std::mutex> lock(stale_mutex_);
+    if (successes == replicas.size()) {
+        stale_replicas_.erase(key);
+        return;
+    }
+
+    std::set<size_t>& stale = stale_replicas_[key];
+    for (size_t i = 0; i < replicas.size(); ++i) {
+        if (succeeded[i]) {
+            stale.erase(replicas[i]);
+        } else {
+            stale.insert(replicas[i]);
+        }
+    }
+}
+
+std::vector<size_t> FileRouterImpl::AllBackends() const {
+    std::vector<size_t> all(backends_.size());
+    for (size_t i = 0; i < all.size(); ++i) {
+        all[i] = i;
+    }
+    return all;
+}
+
+template <typename Response, typename Call>
+std::vector<std::pair<Status, Response>> FileRouterImpl::FanOut(ServerContext* context,
+                                                                const std::vector<size_t>& backends,
+                                                                Call call) {
+    std::vector<std::pair<Status, Response>> results(backends.size());
+
+    auto run = [&](size_t i) {
+        ClientContext client_context;
+        PrepareBackendContext(context, &client_context);
+        results[i].first = call(backends_[backends[i]].get(), &client_context, &results[i].second);
+    };
+
+    if (backends.size() == 1) {
+        run(0);
+        return results;
+    }
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < backends.size(); ++i) {
+        threads.emplace_back(run, i);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return results;
+}
+
+template <typename Response, typename Call>
+Status FileRouterImpl::ReplicatedWrite(ServerContext* context, const std::string& filename,
+                                       Call call, Response* response) {
+    std::vector<size_t> replicas = ReplicasFor(filename);
+    auto results = FanOut<Response>(context, replicas, call);
+
+    size_t succeeded = 0;
+    size_t transport_failures = 0;
+    std::vector<bool> outcomes(results.size());
+    std::string failure;
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto& [status, reply] = results[i];
+        outcomes[i] = status.ok() && reply.success();
+        if (outcomes[i]) {
+            ++succeeded;
+            continue;
+        }
+        if (!status.ok()) {
+            ++transport_failures;
+        }
+        if (failure.empty()) {
+            failure = ring_.node(replicas[i]) + ": " +
+                      (status.ok() ? reply.message() : status.error_message());
+        }
+    }
+    RecordWriteOutcome(filename, replicas, outcomes);
+
+    if (transport_failures == results.size()) {
+        // Every replica failed at the RPC level (e.g. all shedding load);
+        // surface the status itself so the client can back off.
+        return results[0].first;
+    }
+
+    if (succeeded == results.size() || (succeeded == 0 && results[0].first.ok())) {
+        // Unanimous: pass the primary's answer straight through.
+        *response = results[0].second;
+        return Status::OK;
+    }
+
+    response->set_success(false);
+    response->set_message("Succeeded on " + std::to_string(succeeded) + " of " +
+                          std::to_string(results.size()) + " replicas (" + failure + ")");
+    return Status::OK;
+}
+
+std::chrono::milliseconds FileRouterImpl::HedgeDelay(const std::string& method) {
+    std::lock_guard<std::mutex> lock(latency_mutex_);
+    auto it = latencies_.find(method);
+    if (it == latencies_.end() || !it->second.primed) {
+        return min_hedge_delay_;
+    }
+    auto estimate = std::chrono::milliseconds(
+        static_cast<int64_t>(it->second.mean_ms + 4 * it->second.deviation_ms));
+    return std::max(estimate, min_hedge_delay_);
+}
+
+void FileRouterImpl::RecordLatency(const std::string& method,
+                                   std::chrono::steady_clock::duration latency) {
+    double sample = std::chrono::duration<double, std::milli>(latency).count();
+    std::lock_guard<std::mutex> lock(latency_mutex_);
+    LatencyEstimate& estimate = latencies_[method];
+    if (!estimate.primed) {
+        estimate.mean_ms = sample;
+        estimate.deviation_ms = sample / 2;
+        estimate.primed = true;
+        return;
+    }
+    estimate.deviation_ms += (std::abs(sample - estimate.mean_ms) - estimate.deviation_ms) / 4;
+    estimate.mean_ms += (sample - estimate.mean_ms) / 8;
+}
+
+template <typename Response, typename Call>
+Status FileRouterImpl::ReplicaRead(ServerContext* context, const std::string& filename,
+                                   const std::string& method, bool hedge, Call call,
+                                   Response* response) {
+    struct Attempt {
+        ClientContext context;
+        Response response;
+        Status status;
+        bool done = false;
+    };
+
+    std::vector<size_t> replicas = FreshReplicasFor(filename);
+    std::vector<std::unique_ptr<Attempt>> attempts;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable finished_cv;
+    size_t finished = 0;
+    int winner = -1;
+    int shed = -1;
+
+    auto launch = [&]() {
+        size_t index = attempts.size();
+        attempts.push_back(std::make_unique<Attempt>());
+        Attempt* attempt = attempts.back().get();
+        PrepareBackendContext(context, &attempt->context);
+        FileService::Stub* stub = backends_[replicas[index]].get();
+
+        threads.emplace_back([&, attempt, stub, index]() {
+            auto started = std::chrono::steady_clock::now();
+            Status status = call(stub, &attempt->context, &attempt->response);
+            if (status.ok()) {
+                RecordLatency(method, std::chrono::steady_clock::now() - started);
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            attempt->status = status;
+            attempt->done = true;
+            ++finished;
+            if (winner < 0 && status.ok() && attempt->response.success()) {
+                winner = static_cast<int>(index);
+            }
+            if (shed < 0 && status.error_code() == grpc::StatusCode::RESOURCE_EXHAUSTED) {
+                shed = static_cast<int>(index);
+            }
+            finished_cv.notify_all();
+        });
+    };
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto settled = [&]() { return winner >= 0 || finished == attempts.size(); };
+
+        launch();
+        while (winner < 0) {
+            if (shed >= 0 || attempts.size() == replicas.size()) {
+                finished_cv.wait(lock, settled);
+                break;
+            }
+            if (hedge) {
+                finished_cv.wait_for(lock, HedgeDelay(method), settled);
+            } else {
+                finished_cv.wait(lock, settled);
+            }
+            if (winner < 0 && shed < 0) {
+                launch();
+            }
+        }
+
+        for (auto& attempt : attempts) {
+            if (!attempt->done) {
+                attempt->context.TryCancel();
+            }
+        }
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    if (winner >= 0) {
+        *response = std::move(attempts[winner]->response);
+        return Status::OK;
+    }
+    if (shed >= 0) {
+        return attempts[shed]->status;
+    }
+
+    // No replica had it; report the first real answer (e.g. "File does not
+    // exist") before falling back to a transport error.
+    for (auto& attempt : attempts) {
+        if (attempt->status.ok()) {
+            *response = std::move(attempt->response);
+            return Status::OK;
+        }
+    }
+    return attempts.front()->status;
+}
+
+Status FileRouterImpl::CreateFile(ServerContext* context, const CreateFileRequest* request,
+                                 CreateFileResponse* response) {
+    return ReplicatedWrite(context, request->filename(),
+        [request](FileService::Stub* stub, ClientContext* client_context, CreateFileResponse* reply) {
+            return stub->CreateFile(client_context, *request, reply);
+        }, response);
+}
+
+Status FileRouterImpl::ReadFile(ServerContext* context, const ReadFileRequest* request,
+                               ReadFileResponse* response) {
+    // File contents can be large, so a slow read is normal: only fail over,
+    // never duplicate the transfer on a timer.
+    return ReplicaRead(context, request->filename(), "ReadFile", false,
+        [request](FileService::Stub* stub, ClientContext* client_context, ReadFileResponse* reply) {
+            return stub->ReadFile(client_context, *request, reply);
+        }, response);
+}
+
+Status FileRouterImpl::WriteFile(ServerContext* context, const WriteFileRequest* request,
+                                WriteFileResponse* response) {
+    // Appending to replicas that already disagree (typically a client
+    // retrying an append that partly failed) would apply it twice on some.
+    if (request->append() && HasStaleReplicas(request->filename())) {
+        return Status(grpc::StatusCode::FAILED_PRECONDITION,
+                      "Replicas of " + request->filename() + " diverged after a partial write; "
+                      "rewrite the whole file (without append) to repair them");
+    }
+
+    return ReplicatedWrite(context, request->filename(),
+        [request](FileService::Stub* stub, ClientContext* client_context, WriteFileResponse* reply) {
+            return stub->WriteFile(client_context, *request, reply);
+        }, response);
+}
+
+Status FileRouterImpl::DeleteFile(ServerContext* context, const DeleteFileRequest* request,
+                                 DeleteFileResponse* response) {
+    return ReplicatedWrite(context, request->filename(),
+        [request](FileService::Stub* stub, ClientContext* client_context, DeleteFileResponse* reply) {
+            return stub->DeleteFile(client_context, *request, reply);
+        }, response);
+}
+
+Status FileRouterImpl::ListFiles(ServerContext* context, const ListFilesRequest* request,
+                                ListFilesResponse* response) {
+    // A directory's entries are scattered across every shard.
+    std::vector<size_t> backends = AllBackends();
+    auto results = FanOut<ListFilesResponse>(context, backends,
+        [request](FileService::Stub* stub, ClientContext* client_context, ListFilesResponse* reply) {
+            return stub->ListFiles(client_context, *request, reply);
+        });
+
+    std::set<std::string> files;
+    std::set<std::string> directories;
+    bool found = false;
+    size_t unreachable = 0;
+    std::string failure;
+    Status shed;
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto& [status, reply] = results[i];
+        if (!status.ok()) {
+            ++unreachable;
+            if (shed.ok() && status.error_code() == grpc::StatusCode::RESOURCE_EXHAUSTED) {
+                shed = status;
+            }
+            if (failure.empty()) {
+                failure = "Shard " + ring_.node(backends[i]) + " unavailable: " + status.error_message();
+            }
+            continue;
+        }
+        if (!reply.success()) {
+            continue;
+        }
+        found = true;
+        files.insert(reply.files().begin(), reply.files().end());
+        directories.insert(reply.directories().begin(), reply.directories().end());
+    }
+
+    // Every file lives on replicas_ shards, so fewer unreachable shards
+    // than that still leaves a copy of everything in the merged listing.
+    if (unreachable >= replicas_) {
+        if (!shed.ok()) {
+            // Backpressure, not an outage: let the client back off.
+            return shed;
+        }
+        response->set_success(false);
+        response->set_message(failure);
+        return Status::OK;
+    }
+
+    if (!found) {
+        // Every shard refused (e.g. no such directory); pass one answer on.
+        auto answered = std::find_if(results.begin(), results.end(),
+            [](const std::pair<Status, ListFilesResponse>& result) { return result.first.ok(); });
+        *response = answered->second;
+        return Status::OK;
+    }
+
+    for (const auto& file : files) {
+        response->add_files(file);
+    }
+    for (const auto& directory : directories) {
+        response->add_directories(directory);
+    }
+    response->set_success(true);
+    response->set_message(unreachable == 0 ? "Directory listed successfully"
+        : "Directory listed; " + std::to_string(unreachable) + " shard(s) unreachable, "
+          "entries that are stale or only created there may be missing");
+    return Status::OK;
+}
+
+Status FileRouterImpl::CreateDirectory(ServerContext* context, const CreateDirectoryRequest* request,
+                                      CreateDirectoryResponse* response) {
+    // Created everywhere so the directory lists no matter where its files land.
+    std::vector<size_t> backends = AllBackends();
+    auto results = FanOut<CreateDirectoryResponse>(context, backends,
+        [request](FileService::Stub* stub, ClientContext* client_context, CreateDirectoryResponse* reply) {
+            return stub->CreateDirectory(client_context, *request, reply);
+        });
+
+    // Same availability rule as ListFiles: the directory only needs to
+    // exist somewhere to list, and shards that missed it create parent
+    // directories on demand when a file lands there.
+    size_t unreachable = 0;
+    std::string failure;
+    Status shed;
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (!results[i].first.ok()) {
+            ++unreachable;
+            if (shed.ok() && results[i].first.error_code() == grpc::StatusCode::RESOURCE_EXHAUSTED) {
+                shed = results[i].first;
+            }
+            if (failure.empty()) {
+                failure = "Shard " + ring_.node(backends[i]) + " unavailable: " +
+                          results[i].first.error_message();
+            }
+        }
+    }
+    if (unreachable >= replicas_) {
+        if (!shed.ok()) {
+            return shed;
+        }
+        response->set_success(false);
+        response->set_message(failure);
+        return Status::OK;
+    }
+
+    auto created = std::find_if(results.begin(), results.end(),
+        [](const std::pair<Status, CreateDirectoryResponse>& result) {
+            return result.first.ok() && result.second.success();
+        });
+    auto answered = std::find_if(results.begin(), results.end(),
+        [](const std::pair<Status, CreateDirectoryResponse>& result) {
+            return result.first.ok();
+        });
+    *response = (created != results.end()) ? created->second : answered->second;
+    if (unreachable > 0 && response->success()) {
+        response->set_message(response->message() + " (" + std::to_string(unreachable) +
+                              " shard(s) unreachable)");
+    }
+    return Status::OK;
+}
+
+Status FileRouterImpl::GetFileInfo(ServerContext* context, const GetFileInfoRequest* request,
+                                  GetFileInfoResponse* response) {
+    return ReplicaRead(context, request->filename(), "GetFileInfo", true,
+        [request](FileService::Stub* stub, ClientContext* client_context, GetFileInfoResponse* reply) {
+            return stub->GetFileInfo(client_context, *request, reply);
+        }, response);
+}
+
+Status FileRouterImpl::GetFileSignature(ServerContext* context, const GetFileSignatureRequest* request,
+                                       ServerWriter<GetFileSignatureResponse>* writer) {
+    // Signatures come from the first up-to-date replica; ApplyFileDelta below sends the
+    // resulting delta to every replica, and any replica whose copy has
+    // drifted rejects it via its base size and checksum checks.
+    // A replica that fails before sending anything is skipped, as in
+    // ReplicaRead; once part of a stream has gone out it can't be spliced
+    // with another replica's, and load shedding is passed straight back.
+    std::vector<size_t> replicas = FreshReplicasFor(request->filename());
+
+    Status status;
+    for (size_t backend : replicas) {
+        ClientContext client_context;
+        PrepareBackendContext(context, &client_context);
+        auto reader = backends_[backend]->GetFileSignature(&client_context, *request);
+
+        GetFileSignatureResponse message;
+        bool forwarded = false;
+        while (reader->Read(&message)) {
+            forwarded = true;
+            if (!writer->Write(message)) {
+                client_context.TryCancel();
+                break;
+            }
+        }
+        status = reader->Finish();
+
+        if (status.ok() || forwarded || context->IsCancelled() ||
+            status.error_code() == grpc::StatusCode::RESOURCE_EXHAUSTED) {
+            break;
+        }
+    }
+    return status;
+}
+
+Status FileRouterImpl::ApplyFileDelta(ServerContext* context, ServerReader<ApplyFileDeltaRequest>* reader,
+                                     ApplyFileDeltaResponse* response) {
+    ApplyFileDeltaRequest message;
+    if (!reader->Read(&message) || !message.has_header()) {
+        response->set_success(false);
+        response->set_message("Expected delta header");
+        return Status::OK;
+    }
+
+    struct ReplicaStream {
+        ClientContext context;
+        ApplyFileDeltaResponse response;
+        std::unique_ptr<grpc::ClientWriter<ApplyFileDeltaRequest>> writer;
+        bool open = true;
+    };
+
+    const std::string filename = message.header().filename();
+    std::vector<size_t> replicas = ReplicasFor(filename);
+    std::vector<std::unique_ptr<ReplicaStream>> streams;
+    for (size_t backend : replicas) {
+        auto stream = std::make_unique<ReplicaStream>();
+        PrepareBackendContext(context, &stream->context);
+        stream->writer = backends_[backend]->ApplyFileDelta(&stream->context, &stream->response);
+        streams.push_back(std::move(stream));
+    }
+
+    do {
+        for (auto& stream : streams) {
+            if (stream->open && !stream->writer->Write(message)) {
+                stream->open = false;
+            }
+        }
+    } while (reader->Read(&message));
+
+    size_t succeeded = 0;
+    size_t transport_failures = 0;
+    Status first_status;
+    std::vector<bool> outcomes(streams.size());
+    std::string failure;
+    for (size_t i = 0; i < streams.size(); ++i) {
+        auto& stream = *streams[i];
+        if (context->IsCancelled()) {
+            stream.context.TryCancel();
+        } else if (stream.open) {
+            stream.writer->WritesDone();
+        }
+
+        Status status = stream.writer->Finish();
+        if (i == 0) {
+            first_status = status;
+        }
+        outcomes[i] = status.ok() && stream.response.success();
+        if (outcomes[i]) {
+            ++succeeded;
+            continue;
+        }
+        if (!status.ok()) {
+            ++transport_failures;
+        }
+        if (failure.empty()) {
+            failure = ring_.node(replicas[i]) + ": " +
+                      (status.ok() ? stream.response.message() : status.error_message());
+        }
+    }
+
+    RecordWriteOutcome(filename, replicas, outcomes);
+
+    if (transport_failures == streams.size()) {
+        // Same as ReplicatedWrite: let the client see e.g. RESOURCE_EXHAUSTED.
+        return first_status;
+    }
+
+    if (succeeded == streams.size()) {
+        *response = streams[0]->response;
+        return Status::OK;
+    }
+
+    response->set_success(false);
+    response->set_message("Synced on " + std::to_string(succeeded) + " of " +
+                          std::to_string(streams.size()) + " replicas (" + failure + ")");
+    return Status::OK;
+}
+
+void RunRouter(const std::string& listen_address, const std::vector<std::string>& backend_addresses,
+               size_t replicas, std::chrono::milliseconds min_hedge_delay) {
+    FileRouterImpl service(backend_addresses, replicas, min_hedge_delay);
+
+    ServerBuilder builder;
+    builder.AddListeningPort(listen_address, grpc::InsecureServerCredentials());
+    builder.RegisterService(&service);
+
+    std::unique_ptr<Server> server(builder.BuildAndStart());
+    std::cout << "File Router listening on " << listen_address << std::endl;
+    std::cout << "Backends (" << std::min(replicas, backend_addresses.size())
+              << " replicas per path):" << std::endl;
+    for (const auto& address : backend_addresses) {
+        std::cout << "  " << address << std::endl;
+    }
+
+    server->Wait();
+}
+
+int main(int argc, char** argv) {
+    const std::string hedge_flag = "--hedge-delay-ms=";
+    std::chrono::milliseconds min_hedge_delay(50);
+
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind(hedge_flag, 0) == 0) {
+            int delay_ms = std::atoi(arg.c_str() + hedge_flag.size());
+            min_hedge_delay = std::chrono::milliseconds(std::max(0, delay_ms));
+        } else {
+            args.push_back(arg);
+        }
+    }
+
+    if (args.size() < 3) {
+        std::cout << "Usage: file_router [--hedge-delay-ms=N] <listen_address> <replicas> <backend> [backend...]"
+                  << std::endl;
+        std::cout << "Example: file_router localhost:50051 2 127.0.0.1:50061 127.0.0.1:50062 127.0.0.1:50063"
+                  << std::endl;
+        return 1;
+    }
+
+    std::string listen_address = args[0];
+    size_t replicas = static_cast<size_t>(std::max(1, std::atoi(args[1].c_str())));
+    std::vector<std::string> backend_addresses(args.begin() + 2, args.end());
+
+    RunRouter(listen_address, backend_addresses, replicas, min_hedge_delay);
+    return 0;
+}
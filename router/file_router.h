@@ -0,0 +1,145 @@
+#ifndef FILE_ROUTER_H
+#define FILE_ROUTER_H
+
+#include <grpcpp/grpcpp.h>
+#include <grpcpp/server_builder.h>
+#include "file_service.grpc.pb.h"
+#include "hash_ring.h"
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using grpc::Server;
+using grpc::ServerBuilder;
+using grpc::ServerContext;
+using grpc::ServerReader;
+using grpc::ServerWriter;
+using grpc::ClientContext;
+using grpc::Status;
+
+using filemanagement::FileService;
+using filemanagement::CreateFileRequest;
+using filemanagement::CreateFileResponse;
+using filemanagement::ReadFileRequest;
+using filemanagement::ReadFileResponse;
+using filemanagement::WriteFileRequest;
+using filemanagement::WriteFileResponse;
+using filemanagement::DeleteFileRequest;
+using filemanagement::DeleteFileResponse;
+using filemanagement::ListFilesRequest;
+using filemanagement::ListFilesResponse;
+using filemanagement::CreateDirectoryRequest;
+using filemanagement::CreateDirectoryResponse;
+using filemanagement::GetFileInfoRequest;
+using filemanagement::GetFileInfoResponse;
+using filemanagement::GetFileSignatureRequest;
+using filemanagement::GetFileSignatureResponse;
+using filemanagement::ApplyFileDeltaRequest;
+using filemanagement::ApplyFileDeltaResponse;
+
+// Speaks the same FileService protocol as file_server, but owns no storage:
+// each path is mapped onto `replicas` of the backend servers through a
+// consistent-hash ring. Writes go to every replica, reads fail over between
+// them (and hedge, for cheap metadata reads), and directory operations fan
+// out to all backends.
+class FileRouterImpl final : public FileService::Service {
+public:
+    FileRouterImpl(const std::vector<std::string>& backend_addresses, size_t replicas,
+                   std::chrono::milliseconds min_hedge_delay = std::chrono::milliseconds(50));
+
+private:
+    Status CreateFile(ServerContext* context, const CreateFileRequest* request,
+                     CreateFileResponse* response) override;
+
+    Status ReadFile(ServerContext* context, const ReadFileRequest* request,
+                   ReadFileResponse* response) override;
+
+    Status WriteFile(ServerContext* context, const WriteFileRequest* request,
+                    WriteFileResponse* response) override;
+
+    Status DeleteFile(ServerContext* context, const DeleteFileRequest* request,
+                     DeleteFileResponse* response) override;
+
+    Status ListFiles(ServerContext* context, const ListFilesRequest* request,
+                    ListFilesResponse* response) override;
+
+    Status CreateDirectory(ServerContext* context, const CreateDirectoryRequest* request,
+                          CreateDirectoryResponse* response) override;
+
+    Status GetFileInfo(ServerContext* context, const GetFileInfoRequest* request,
+                      GetFileInfoResponse* response) override;
+
+    Status GetFileSignature(ServerContext* context, const GetFileSignatureRequest* request,
+                           ServerWriter<GetFileSignatureResponse>* writer) override;
+
+    Status ApplyFileDelta(ServerContext* context, ServerReader<ApplyFileDeltaRequest>* reader,
+                         ApplyFileDeltaResponse* response) override;
+
+    // Backends holding `filename`, primary first.
+    std::vector<size_t> ReplicasFor(const std::string& filename) const;
+    // ReplicasFor minus any replica known to have missed a write.
+    std::vector<size_t> FreshReplicasFor(const std::string& filename);
+    bool HasStaleReplicas(const std::string& filename);
+    void RecordWriteOutcome(const std::string& filename, const std::vector<size_t>& replicas,
+                            const std::vector<bool>& succeeded);
+    std::vector<size_t> AllBackends() const;
+
+    // Calls every backend in `backends` concurrently and returns their
+    // results in the same order.
+    template <typename Response, typename Call>
+    std::vector<std::pair<Status, Response>> FanOut(ServerContext* context,
+                                                    const std::vector<size_t>& backends,
+                                                    Call call);
+
+    // Sends a write to every replica; succeeds only if all of them did.
+    // Replicas that failed while others succeeded are marked stale.
+    template <typename Response, typename Call>
+    Status ReplicatedWrite(ServerContext* context, const std::string& filename,
+                           Call call, Response* response);
+
+    // Asks the primary first and moves on to the next replica when the
+    // previous ones have failed. With `hedge` set it also moves on once the
+    // in-flight attempts are slower than usual for `method`. The first
+    // successful answer wins and the rest are cancelled. A backend shedding
+    // load (RESOURCE_EXHAUSTED) stops the search so backpressure reaches
+    // the client instead of being spread to the other replicas.
+    template <typename Response, typename Call>
+    Status ReplicaRead(ServerContext* context, const std::string& filename,
+                       const std::string& method, bool hedge, Call call, Response* response);
+
+    // Hedge after roughly the p99 of recent latency (mean + 4 deviations,
+    // as TCP does for its retransmit timer), never sooner than the floor.
+    std::chrono::milliseconds HedgeDelay(const std::string& method);
+    void RecordLatency(const std::string& method, std::chrono::steady_clock::duration latency);
+
+    HashRing ring_;
+    std::vector<std::unique_ptr<FileService::Stub>> backends_;
+    size_t replicas_;
+    std::chrono::milliseconds min_hedge_delay_;
+
+    struct LatencyEstimate {
+        double mean_ms = 0;
+        double deviation_ms = 0;
+        bool primed = false;
+    };
+    std::mutex latency_mutex_;
+    std::unordered_map<std::string, LatencyEstimate> latencies_;
+
+    // Replicas that missed a write to a path, keyed by route key. Reads
+    // skip them and appends are refused until a write that fully replaces
+    // the file succeeds everywhere. Kept in memory only, so a router
+    // restart forgets it.
+    std::mutex stale_mutex_;
+    std::unordered_map<std::string, std::set<size_t>> stale_replicas_;
+};
+
+void RunRouter(const std::string& listen_address, const std::vector<std::string>& backend_addresses,
+               size_t replicas, std::chrono::milliseconds min_hedge_delay);
+
+#endif // FILE_ROUTER_H
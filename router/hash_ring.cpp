@@ -0,0 +1,50 @@
+#include "hash_ring.h"
+#include <algorithm>
+
+HashRing::HashRing(int virtual_nodes)
+    : virtual_nodes_(std::max(virtual_nodes, 1)) {}
+
+uint64_t HashRing::Hash(const std::string& key) {
+    // FNV-1a, then a splitmix64 finalizer: FNV alone clusters similar
+    // strings like "node#1", "node#2".
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 0x100000001b3ull;
+    }
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9ull;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebull;
+    hash ^= hash >> 31;
+    return hash;
+}
+
+size_t HashRing::AddNode(const std::string& node) {
+    size_t index = nodes_.size();
+    nodes_.push_back(node);
+    for (int i = 0; i < virtual_nodes_; ++i) {
+        // On the rare collision the earlier node keeps the point.
+        ring_.emplace(Hash(node + "#" + std::to_string(i)), index);
+    }
+    return index;
+}
+
+std::vector<size_t> HashRing::NodesFor(const std::string& key, size_t count) const {
+    std::vector<size_t> result;
+    count = std::min(count, nodes_.size());
+    if (count == 0) {
+        return result;
+    }
+
+    auto it = ring_.lower_bound(Hash(key));
+    for (size_t steps = 0; steps < ring_.size() && result.size() < count; ++steps, ++it) {
+        if (it == ring_.end()) {
+            it = ring_.begin();
+        }
+        if (std::find(result.begin(), result.end(), it->second) == result.end()) {
+            result.push_back(it->second);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,34 @@
+#ifndef HASH_RING_H
+#define HASH_RING_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Consistent-hash ring. Each node is placed at many pseudo-random points
+// ("virtual nodes") so keys spread evenly and adding or removing a node
+// only moves about 1/N of them.
+class HashRing {
+public:
+    explicit HashRing(int virtual_nodes = 160);
+
+    // Returns the new node's index.
+    size_t AddNode(const std::string& node);
+
+    // Up to `count` distinct node indices for `key`, walking clockwise from
+    // its hash. The first entry is the primary owner.
+    std::vector<size_t> NodesFor(const std::string& key, size_t count) const;
+
+    size_t size() const { return nodes_.size(); }
+    const std::string& node(size_t index) const { return nodes_[index]; }
+
+private:
+    static uint64_t Hash(const std::string& key);
+
+    int virtual_nodes_;
+    std::map<uint64_t, size_t> ring_;
+    std::vector<std::string> nodes_;
+};
+
+#endif // HASH_RING_H
@@ -0,0 +1,240 @@
+#include "admission_control.h"
+#include <algorithm>
+
+namespace {
+
+constexpr size_t kMaxTrackedPeers = 4096;
+constexpr auto kCancellationPollInterval = std::chrono::milliseconds(50);
+
+}  // namespace
+
+AdmissionTicket::AdmissionTicket(AdmissionTicket&& other) noexcept
+    : controller_(other.controller_), rpc_class_(other.rpc_class_), bytes_(other.bytes_) {
+    other.controller_ = nullptr;
+}
+
+AdmissionTicket& AdmissionTicket::operator=(AdmissionTicket&& other) noexcept {
+    if (this != &other) {
+        Release();
+        controller_ = other.controller_;
+        rpc_class_ = other.rpc_class_;
+        bytes_ = other.bytes_;
+        other.controller_ = nullptr;
+    }
+    return *this;
+}
+
+AdmissionTicket::~AdmissionTicket() {
+    Release();
+}
+
+void AdmissionTicket::Release() {
+    if (controller_ != nullptr) {
+        controller_->Release(rpc_class_, bytes_);
+        controller_ = nullptr;
+    }
+}
+
+AdmissionController::TokenBucket::TokenBucket(const RateLimit& limit,
+                                              std::chrono::steady_clock::time_point now)
+    : limit_(limit), tokens_(limit.burst), last_refill_(now) {}
+
+void AdmissionController::TokenBucket::Refill(std::chrono::steady_clock::time_point now) {
+    std::chrono::duration<double> elapsed = now - last_refill_;
+    tokens_ = std::min(limit_.burst, tokens_ + elapsed.count() * limit_.requests_per_second);
+    last_refill_ = now;
+}
+
+bool AdmissionController::TokenBucket::TryTake(std::chrono::steady_clock::time_point now) {
+    Refill(now);
+    if (tokens_ < 1) {
+        return false;
+    }
+    tokens_ -= 1;
+    return true;
+}
+
+bool AdmissionController::TokenBucket::IsFull(std::chrono::steady_clock::time_point now) {
+    Refill(now);
+    return tokens_ >= limit_.burst;
+}
+
+AdmissionController::AdmissionController(const AdmissionConfig& config)
+    : config_(config) {
+    config_.max_concurrent_rpcs = std::max<size_t>(config_.max_concurrent_rpcs, 1);
+    config_.reserved_metadata_slots =
+        std::min(config_.reserved_metadata_slots, config_.max_concurrent_rpcs - 1);
+    config_.max_inflight_bytes = std::max<uint64_t>(config_.max_inflight_bytes, 1);
+}
+
+int AdmissionController::RecommendedMaxThreads(const AdmissionConfig& config) {
+    // Every running or queued RPC pins a sync-server thread, plus headroom
+    // for the ones being rejected.
+    return static_cast<int>(config.max_concurrent_rpcs + 2 * config.max_queue_depth + 16);
+}
+
+std::string AdmissionController::ClientKey(grpc::ServerContext* context) const {
+    std::string peer = PeerHost(context->peer());
+    // "ipv6:[::1]" -> "::1", so forwarders can be listed as plain addresses.
+    std::string address = peer.substr(peer.find(':') + 1);
+    if (address.size() > 2 && address.front() == '[' && address.back() == ']') {
+        address = address.substr(1, address.size() - 2);
+    }
+
+    bool trusted = std::any_of(config_.trusted_forwarders.begin(), config_.trusted_forwarders.end(),
+        [&](const std::string& forwarder) { return forwarder == peer || forwarder == address; });
+    if (!trusted) {
+        return peer;
+    }
+
+    const auto& metadata = context->client_metadata();
+    auto forwarded = metadata.find(kForwardedClientMetadataKey);
+    if (forwarded == metadata.end()) {
+        return peer;
+    }
+    return std::string(forwarded->second.data(), forwarded->second.size());
+}
+
+bool AdmissionController::Fits(RpcClass rpc_class, uint64_t bytes) const {
+    if (active_rpcs_ >= config_.max_concurrent_rpcs) {
+        return false;
+    }
+    if (rpc_class == RpcClass::kBulk &&
+        active_bulk_rpcs_ >= config_.max_concurrent_rpcs - config_.reserved_metadata_slots) {
+        return false;
+    }
+    return inflight_bytes_ + bytes <= config_.max_inflight_bytes;
+}
+
+void AdmissionController::Grant(RpcClass rpc_class, uint64_t bytes) {
+    int index = static_cast<int>(rpc_class);
+    double weight = rpc_class == RpcClass::kMetadata ? config_.metadata_weight : config_.bulk_weight;
+
+    // A class that sat idle must not bank credit and then burst ahead.
+    pass_[index] = std::max(pass_[index], virtual_time_);
+    virtual_time_ = pass_[index];
+    pass_[index] += 1.0 / std::max(weight, 0.001);
+
+    ++active_rpcs_;
+    if (rpc_class == RpcClass::kBulk) {
+        ++active_bulk_rpcs_;
+    }
+    inflight_bytes_ += bytes;
+}
+
+void AdmissionController::Dispatch() {
+    bool granted_any = false;
+    while (true) {
+        int next = -1;
+        for (int index = 0; index < 2; ++index) {
+            if (queues_[index].empty()) {
+                continue;
+            }
+            const Waiter* head = queues_[index].front();
+            if (!Fits(head->rpc_class, head->bytes)) {
+                continue;
+            }
+            if (next < 0 || std::max(pass_[index], virtual_time_) < std::max(pass_[next], virtual_time_)) {
+                next = index;
+            }
+        }
+        if (next < 0) {
+            break;
+        }
+
+        Waiter* waiter = queues_[next].front();
+        queues_[next].pop_front();
+        Grant(waiter->rpc_class, waiter->bytes);
+        waiter->granted = true;
+        granted_any = true;
+    }
+
+    if (granted_any) {
+        dispatched_.notify_all();
+    }
+}
+
+void AdmissionController::Release(RpcClass rpc_class, uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --active_rpcs_;
+    if (rpc_class == RpcClass::kBulk) {
+        --active_bulk_rpcs_;
+    }
+    inflight_bytes_ -= bytes;
+    Dispatch();
+}
+
+void AdmissionController::PruneIdleBuckets(std::chrono::steady_clock::time_point now) {
+    for (auto it = peer_buckets_.begin(); it != peer_buckets_.end();) {
+        if (it->second.IsFull(now)) {
+            it = peer_buckets_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+grpc::Status AdmissionController::Admit(grpc::ServerContext* context, const std::string& method,
+                                        RpcClass rpc_class, uint64_t bytes,
+                                        AdmissionTicket* ticket) {
+    // A request larger than the whole budget may still run, just alone.
+    bytes = std::min(bytes, config_.max_inflight_bytes);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto now = std::chrono::steady_clock::now();
+
+    if (peer_buckets_.size() >= kMaxTrackedPeers) {
+        PruneIdleBuckets(now);
+    }
+
+    std::string peer = ClientKey(context);
+    auto peer_bucket = peer_buckets_.try_emplace(peer, config_.peer_limit, now).first;
+    if (!peer_bucket->second.TryTake(now)) {
+        return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED,
+                            "Rate limit exceeded for " + peer);
+    }
+
+    auto method_limit = config_.method_limits.find(method);
+    if (method_limit != config_.method_limits.end()) {
+        auto method_bucket = method_buckets_.try_emplace(method, method_limit->second, now).first;
+        if (!method_bucket->second.TryTake(now)) {
+            return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED,
+                                "Rate limit exceeded for " + method);
+        }
+    }
+
+    auto& queue = queues_[static_cast<int>(rpc_class)];
+    if (queue.empty() && Fits(rpc_class, bytes)) {
+        Grant(rpc_class, bytes);
+    } else {
+        if (queue.size() >= config_.max_queue_depth) {
+            return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "Server overloaded");
+        }
+
+        Waiter waiter{rpc_class, bytes};
+        queue.push_back(&waiter);
+
+        auto deadline = now + config_.queue_timeout;
+        while (!waiter.granted) {
+            bool cancelled = context->IsCancelled();
+            if (cancelled || std::chrono::steady_clock::now() >= deadline) {
+                queue.erase(std::find(queue.begin(), queue.end(), &waiter));
+                // Whoever was stuck behind this waiter may fit now.
+                Dispatch();
+                if (cancelled) {
+                    return grpc::Status(grpc::StatusCode::CANCELLED, "Cancelled while queued");
+                }
+                return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED,
+                                    "Timed out waiting for server capacity");
+            }
+            dispatched_.wait_for(lock, kCancellationPollInterval);
+        }
+    }
+
+    lock.unlock();
+    *ticket = AdmissionTicket();
+    ticket->controller_ = this;
+    ticket->rpc_class_ = rpc_class;
+    ticket->bytes_ = bytes;
+    return grpc::Status::OK;
+}
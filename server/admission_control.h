@@ -0,0 +1,145 @@
+#ifndef ADMISSION_CONTROL_H
+#define ADMISSION_CONTROL_H
+
+#include <grpcpp/grpcpp.h>
+#include "forwarded_client.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Metadata RPCs are cheap and latency sensitive; bulk RPCs move file
+// contents. They are queued separately so bulk load can't starve metadata.
+enum class RpcClass { kMetadata = 0, kBulk = 1 };
+
+struct RateLimit {
+    double requests_per_second;
+    double burst;
+};
+
+struct AdmissionConfig {
+    // Token bucket applied to every client host, across all methods.
+    RateLimit peer_limit{100, 200};
+
+    // Peers allowed to name the real client via kForwardedClientMetadataKey,
+    // e.g. "127.0.0.1" for a router on the same machine. Matched against
+    // the connection's address exactly, so a router reaching the server
+    // over IPv6 loopback needs "::1". Calls from them are rate-limited per
+    // forwarded client instead of sharing one bucket.
+    std::vector<std::string> trusted_forwarders;
+
+    // Token buckets shared by all clients of a method. Methods not listed
+    // are only subject to the peer limit.
+    std::unordered_map<std::string, RateLimit> method_limits{
+        {"ReadFile", {200, 400}},
+        {"WriteFile", {200, 400}},
+        {"CreateFile", {200, 400}},
+        {"GetFileSignature", {20, 40}},
+        {"ApplyFileDelta", {20, 40}},
+    };
+
+    size_t max_concurrent_rpcs = 32;
+    // Slots bulk RPCs may never take, so metadata always has room to run.
+    size_t reserved_metadata_slots = 4;
+    // Budget for payload bytes held by running RPCs.
+    uint64_t max_inflight_bytes = 512ull * 1024 * 1024;
+
+    // Share of dispatches each class gets when both have waiters.
+    double metadata_weight = 8;
+    double bulk_weight = 1;
+
+    size_t max_queue_depth = 64;
+    std::chrono::milliseconds queue_timeout{2000};
+};
+
+class AdmissionController;
+
+// Held for the lifetime of an admitted RPC; gives its slot and byte budget
+// back on destruction.
+class AdmissionTicket {
+public:
+    AdmissionTicket() = default;
+    AdmissionTicket(AdmissionTicket&& other) noexcept;
+    AdmissionTicket& operator=(AdmissionTicket&& other) noexcept;
+    AdmissionTicket(const AdmissionTicket&) = delete;
+    AdmissionTicket& operator=(const AdmissionTicket&) = delete;
+    ~AdmissionTicket();
+
+private:
+    friend class AdmissionController;
+
+    void Release();
+
+    AdmissionController* controller_ = nullptr;
+    RpcClass rpc_class_ = RpcClass::kMetadata;
+    uint64_t bytes_ = 0;
+};
+
+class AdmissionController {
+public:
+    explicit AdmissionController(const AdmissionConfig& config = AdmissionConfig());
+
+    // Applies rate limits, then waits (bounded) for a concurrency slot and
+    // `bytes` of in-flight budget. Returns RESOURCE_EXHAUSTED when the RPC
+    // should be shed, CANCELLED if the client gave up while queued.
+    grpc::Status Admit(grpc::ServerContext* context, const std::string& method,
+                       RpcClass rpc_class, uint64_t bytes, AdmissionTicket* ticket);
+
+    // Worker threads the gRPC server needs so queued RPCs can't exhaust it.
+    static int RecommendedMaxThreads(const AdmissionConfig& config);
+
+private:
+    friend class AdmissionTicket;
+
+    class TokenBucket {
+    public:
+        TokenBucket(const RateLimit& limit, std::chrono::steady_clock::time_point now);
+        bool TryTake(std::chrono::steady_clock::time_point now);
+        bool IsFull(std::chrono::steady_clock::time_point now);
+
+    private:
+        void Refill(std::chrono::steady_clock::time_point now);
+
+        RateLimit limit_;
+        double tokens_;
+        std::chrono::steady_clock::time_point last_refill_;
+    };
+
+    struct Waiter {
+        RpcClass rpc_class;
+        uint64_t bytes;
+        bool granted = false;
+    };
+
+    bool Fits(RpcClass rpc_class, uint64_t bytes) const;
+    void Grant(RpcClass rpc_class, uint64_t bytes);
+    void Dispatch();
+    void Release(RpcClass rpc_class, uint64_t bytes);
+    void PruneIdleBuckets(std::chrono::steady_clock::time_point now);
+
+    std::string ClientKey(grpc::ServerContext* context) const;
+
+    AdmissionConfig config_;
+
+    std::mutex mutex_;
+    std::condition_variable dispatched_;
+
+    std::unordered_map<std::string, TokenBucket> peer_buckets_;
+    std::unordered_map<std::string, TokenBucket> method_buckets_;
+
+    // Stride scheduling between the two class queues: each dispatch advances
+    // the class's pass by 1/weight and the lowest pass goes next.
+    std::deque<Waiter*> queues_[2];
+    double pass_[2] = {0, 0};
+    double virtual_time_ = 0;
+
+    size_t active_rpcs_ = 0;
+    size_t active_bulk_rpcs_ = 0;
+    uint64_t inflight_bytes_ = 0;
+};
+
+#endif // ADMISSION_CONTROL_H
@@ -1,10 +1,28 @@
 #include "file_server.h"
 #include <windows.h>
 #include <sys/stat.h>
+#include <algorithm>
+#include <random>
 #include <sstream>
 
-FileServiceImpl::FileServiceImpl(const std::string& base_directory) 
-    : base_directory_(base_directory) {
+// Signatures per streamed message; 4096 blocks is roughly 160 KB on the wire.
+constexpr int kSignaturesPerMessage = 4096;
+
+// Streaming RPCs hold about one message worth of payload at a time.
+constexpr uint64_t kStreamingBytesEstimate = 2 * 1024 * 1024;
+
+// Delta output is written next to the target so the final rename stays on
+// the same volume and replaces the old copy in one step.
+static std::string MakeTempPath(const std::string& full_path) {
+    std::random_device random;
+    std::ostringstream name;
+    name << full_path << ".sync-" << std::hex << random() << random() << ".tmp";
+    return name.str();
+}
+
+FileServiceImpl::FileServiceImpl(const std::string& base_directory,
+                                 const AdmissionConfig& admission_config)
+    : base_directory_(base_directory), admission_(admission_config) {
     std::filesystem::create_directories(base_directory_);
 }
 
@@ -25,8 +43,31 @@ bool FileServiceImpl::IsValidPath(const std::string& path) {
     }
 }
 
+uint64_t FileServiceImpl::ExistingFileSize(const std::string& filename) {
+    // Never stat anything outside base_directory_; the handler rejects the
+    // path itself once admitted.
+    try {
+        if (!IsValidPath(filename)) {
+            return 0;
+        }
+    } catch (const std::exception&) {
+        return 0;
+    }
+
+    std::error_code ec;
+    uint64_t size = std::filesystem::file_size(GetFullPath(filename), ec);
+    return ec ? 0 : size;
+}
+
 Status FileServiceImpl::CreateFile(ServerContext* context, const CreateFileRequest* request,
                                   CreateFileResponse* response) {
+    AdmissionTicket ticket;
+    Status admitted = admission_.Admit(context, "CreateFile", RpcClass::kBulk,
+                                       request->content().size(), &ticket);
+    if (!admitted.ok()) {
+        return admitted;
+    }
+
     try {
         if (!IsValidPath(request->filename())) {
             response->set_success(false);
@@ -58,6 +99,13 @@ Status FileServiceImpl::CreateFile(ServerContext* context, const CreateFileReque
 
 Status FileServiceImpl::ReadFile(ServerContext* context, const ReadFileRequest* request,
                                 ReadFileResponse* response) {
+    AdmissionTicket ticket;
+    Status admitted = admission_.Admit(context, "ReadFile", RpcClass::kBulk,
+                                       ExistingFileSize(request->filename()), &ticket);
+    if (!admitted.ok()) {
+        return admitted;
+    }
+
     try {
         if (!IsValidPath(request->filename())) {
             response->set_success(false);
@@ -96,6 +144,13 @@ Status FileServiceImpl::ReadFile(ServerContext* context, const ReadFileRequest*
 
 Status FileServiceImpl::WriteFile(ServerContext* context, const WriteFileRequest* request,
                                  WriteFileResponse* response) {
+    AdmissionTicket ticket;
+    Status admitted = admission_.Admit(context, "WriteFile", RpcClass::kBulk,
+                                       request->content().size(), &ticket);
+    if (!admitted.ok()) {
+        return admitted;
+    }
+
     try {
         if (!IsValidPath(request->filename())) {
             response->set_success(false);
@@ -130,6 +185,12 @@ Status FileServiceImpl::WriteFile(ServerContext* context, const WriteFileRequest
 
 Status FileServiceImpl::DeleteFile(ServerContext* context, const DeleteFileRequest* request,
                                   DeleteFileResponse* response) {
+    AdmissionTicket ticket;
+    Status admitted = admission_.Admit(context, "DeleteFile", RpcClass::kMetadata, 0, &ticket);
+    if (!admitted.ok()) {
+        return admitted;
+    }
+
     try {
         if (!IsValidPath(request->filename())) {
             response->set_success(false);
@@ -161,6 +222,12 @@ Status FileServiceImpl::DeleteFile(ServerContext* context, const DeleteFileReque
 
 Status FileServiceImpl::ListFiles(ServerContext* context, const ListFilesRequest* request,
                                  ListFilesResponse* response) {
+    AdmissionTicket ticket;
+    Status admitted = admission_.Admit(context, "ListFiles", RpcClass::kMetadata, 0, &ticket);
+    if (!admitted.ok()) {
+        return admitted;
+    }
+
     try {
         std::string directory = request->directory().empty() ? "." : request->directory();
         
@@ -197,6 +264,12 @@ Status FileServiceImpl::ListFiles(ServerContext* context, const ListFilesRequest
 
 Status FileServiceImpl::CreateDirectory(ServerContext* context, const CreateDirectoryRequest* request,
                                        CreateDirectoryResponse* response) {
+    AdmissionTicket ticket;
+    Status admitted = admission_.Admit(context, "CreateDirectory", RpcClass::kMetadata, 0, &ticket);
+    if (!admitted.ok()) {
+        return admitted;
+    }
+
     try {
         if (!IsValidPath(request->directory())) {
             response->set_success(false);
@@ -263,6 +336,12 @@ Status FileServiceImpl::CreateDirectory(ServerContext* context, const CreateDire
 // }
 Status FileServiceImpl::GetFileInfo(ServerContext* context, const GetFileInfoRequest* request,
                                    GetFileInfoResponse* response) {
+    AdmissionTicket ticket;
+    Status admitted = admission_.Admit(context, "GetFileInfo", RpcClass::kMetadata, 0, &ticket);
+    if (!admitted.ok()) {
+        return admitted;
+    }
+
     try {
         if (!IsValidPath(request->filename())) {
             response->set_success(false);
@@ -325,10 +404,187 @@ Status FileServiceImpl::DownloadFile(ServerContext* context, const DownloadFileR
     return Status(grpc::StatusCode::UNIMPLEMENTED, "Download not implemented in basic version");
 }
 
-void RunServer(const std::string& server_address, const std::string& base_directory) {
-    FileServiceImpl service(base_directory);
+Status FileServiceImpl::GetFileSignature(ServerContext* context, const GetFileSignatureRequest* request,
+                                        ServerWriter<GetFileSignatureResponse>* writer) {
+    AdmissionTicket ticket;
+    Status admitted = admission_.Admit(context, "GetFileSignature", RpcClass::kBulk,
+                                       kStreamingBytesEstimate, &ticket);
+    if (!admitted.ok()) {
+        return admitted;
+    }
+
+    GetFileSignatureResponse header_message;
+    auto header = header_message.mutable_header();
+    std::vector<deltasync::BlockSignature> signatures;
+
+    try {
+        if (!IsValidPath(request->filename())) {
+            header->set_success(false);
+            header->set_message("Invalid file path");
+            writer->Write(header_message);
+            return Status::OK;
+        }
+
+        std::string full_path = GetFullPath(request->filename());
+
+        // A missing file has no blocks to reuse; the client just sends literals.
+        uint64_t file_size = 0;
+        bool exists = std::filesystem::exists(full_path);
+        if (exists) {
+            if (!std::filesystem::is_regular_file(full_path)) {
+                header->set_success(false);
+                header->set_message("Not a regular file");
+                writer->Write(header_message);
+                return Status::OK;
+            }
+            file_size = std::filesystem::file_size(full_path);
+        }
+
+        uint32_t block_size = request->block_size() == 0
+            ? deltasync::ChooseBlockSize(file_size)
+            : std::clamp(request->block_size(), deltasync::kMinBlockSize, deltasync::kMaxBlockSize);
+
+        signatures = deltasync::ComputeSignatures(full_path, file_size, block_size);
+
+        header->set_success(true);
+        header->set_message(exists ? "Signature computed successfully"
+                                   : "File does not exist, full contents required");
+        header->set_file_size(static_cast<int64_t>(file_size));
+        header->set_block_size(block_size);
+    } catch (const std::exception& e) {
+        header->set_success(false);
+        header->set_message("Error: " + std::string(e.what()));
+        writer->Write(header_message);
+        return Status::OK;
+    }
+
+    if (!writer->Write(header_message)) {
+        return Status::OK;
+    }
+
+    GetFileSignatureResponse batch;
+    for (const auto& signature : signatures) {
+        auto block = batch.mutable_signatures()->add_blocks();
+        block->set_weak_checksum(signature.weak);
+        block->set_strong_checksum(signature.strong);
+
+        if (batch.signatures().blocks_size() == kSignaturesPerMessage) {
+            if (context->IsCancelled() || !writer->Write(batch)) {
+                return Status(grpc::StatusCode::CANCELLED, "Signature stream cancelled");
+            }
+            batch.Clear();
+        }
+    }
+    if (batch.has_signatures()) {
+        writer->Write(batch);
+    }
+    return Status::OK;
+}
+
+Status FileServiceImpl::ApplyFileDelta(ServerContext* context, ServerReader<ApplyFileDeltaRequest>* reader,
+                                      ApplyFileDeltaResponse* response) {
+    AdmissionTicket ticket;
+    Status admitted = admission_.Admit(context, "ApplyFileDelta", RpcClass::kBulk,
+                                       kStreamingBytesEstimate, &ticket);
+    if (!admitted.ok()) {
+        return admitted;
+    }
+
+    ApplyFileDeltaRequest message;
+    if (!reader->Read(&message) || !message.has_header()) {
+        response->set_success(false);
+        response->set_message("Expected delta header");
+        return Status::OK;
+    }
+    const filemanagement::DeltaHeader header = message.header();
+
+    std::string temp_path;
+    try {
+        if (!IsValidPath(header.filename())) {
+            response->set_success(false);
+            response->set_message("Invalid file path");
+            return Status::OK;
+        }
+
+        std::string full_path = GetFullPath(header.filename());
+
+        // Signatures describe the copy that existed when they were computed;
+        // refuse to patch a file that has since been replaced or resized.
+        uint64_t base_size = std::filesystem::exists(full_path)
+            ? std::filesystem::file_size(full_path) : 0;
+        if (base_size != static_cast<uint64_t>(header.base_file_size())) {
+            response->set_success(false);
+            response->set_message("File changed since signature was computed");
+            return Status::OK;
+        }
+        if (base_size > 0 && (header.block_size() < deltasync::kMinBlockSize ||
+                              header.block_size() > deltasync::kMaxBlockSize)) {
+            response->set_success(false);
+            response->set_message("Invalid block size");
+            return Status::OK;
+        }
+
+        std::filesystem::create_directories(std::filesystem::path(full_path).parent_path());
+        temp_path = MakeTempPath(full_path);
+
+        deltasync::DeltaStats stats;
+        filemanagement::DeltaTrailer trailer;
+        bool has_trailer = false;
+        {
+            deltasync::DeltaApplier applier(full_path, base_size, header.block_size(), temp_path);
+            while (reader->Read(&message)) {
+                if (message.has_instructions()) {
+                    for (const auto& instruction : message.instructions().instructions()) {
+                        if (instruction.has_copy()) {
+                            applier.Copy(instruction.copy().first_block(),
+                                         instruction.copy().block_count());
+                        } else {
+                            applier.Literal(instruction.literal());
+                        }
+                    }
+                } else if (message.has_trailer()) {
+                    trailer = message.trailer();
+                    has_trailer = true;
+                }
+            }
+            stats = applier.Finish();
+        }
+
+        if (context->IsCancelled() || !has_trailer) {
+            throw std::runtime_error("Delta stream ended early");
+        }
+        if (stats.file_size != static_cast<uint64_t>(trailer.file_size()) ||
+            stats.sha256 != trailer.sha256()) {
+            throw std::runtime_error("Checksum mismatch after applying delta");
+        }
+
+        std::filesystem::rename(temp_path, full_path);
+
+        response->set_success(true);
+        response->set_message("File synced successfully");
+        response->set_file_size(static_cast<int64_t>(stats.file_size));
+    } catch (const std::exception& e) {
+        if (!temp_path.empty()) {
+            std::error_code ec;
+            std::filesystem::remove(temp_path, ec);
+        }
+        response->set_success(false);
+        response->set_message("Error: " + std::string(e.what()));
+    }
+    return Status::OK;
+}
+
+void RunServer(const std::string& server_address, const std::string& base_directory,
+               const AdmissionConfig& admission_config) {
+    FileServiceImpl service(base_directory, admission_config);
+
+    // Cap sync-server threads so a flood of queued RPCs is refused by gRPC
+    // instead of spawning a thread each.
+    grpc::ResourceQuota quota("file_server");
+    quota.SetMaxThreads(AdmissionController::RecommendedMaxThreads(admission_config));
 
     ServerBuilder builder;
+    builder.SetResourceQuota(quota);
     builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
     builder.RegisterService(&service);
 
@@ -350,6 +606,19 @@ int main(int argc, char** argv) {
         base_directory = argv[2];
     }
 
-    RunServer(server_address, base_directory);
+    // Optional comma-separated list of router hosts (cluster mode) whose
+    // forwarded client identity admission control should trust.
+    AdmissionConfig admission_config;
+    if (argc > 3) {
+        std::istringstream forwarders(argv[3]);
+        std::string forwarder;
+        while (std::getline(forwarders, forwarder, ',')) {
+            if (!forwarder.empty()) {
+                admission_config.trusted_forwarders.push_back(forwarder);
+            }
+        }
+    }
+
+    RunServer(server_address, base_directory, admission_config);
     return 0;
 }
@@ -4,6 +4,8 @@
 #include <grpcpp/grpcpp.h>
 #include <grpcpp/server_builder.h>
 #include "file_service.grpc.pb.h"
+#include "delta_sync.h"
+#include "admission_control.h"
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -35,10 +37,15 @@ using filemanagement::UploadFileRequest;
 using filemanagement::UploadFileResponse;
 using filemanagement::DownloadFileRequest;
 using filemanagement::DownloadFileResponse;
+using filemanagement::GetFileSignatureRequest;
+using filemanagement::GetFileSignatureResponse;
+using filemanagement::ApplyFileDeltaRequest;
+using filemanagement::ApplyFileDeltaResponse;
 
 class FileServiceImpl final : public FileService::Service {
 public:
-    FileServiceImpl(const std::string& base_directory);
+    FileServiceImpl(const std::string& base_directory,
+                    const AdmissionConfig& admission_config = AdmissionConfig());
 
 private:
     Status CreateFile(ServerContext* context, const CreateFileRequest* request,
@@ -68,12 +75,21 @@ private:
     Status DownloadFile(ServerContext* context, const DownloadFileRequest* request,
                        ServerWriter<DownloadFileResponse>* writer) override;
 
+    Status GetFileSignature(ServerContext* context, const GetFileSignatureRequest* request,
+                           ServerWriter<GetFileSignatureResponse>* writer) override;
+
+    Status ApplyFileDelta(ServerContext* context, ServerReader<ApplyFileDeltaRequest>* reader,
+                         ApplyFileDeltaResponse* response) override;
+
     std::string GetFullPath(const std::string& filename);
     bool IsValidPath(const std::string& path);
+    uint64_t ExistingFileSize(const std::string& filename);
 
     std::string base_directory_;
+    AdmissionController admission_;
 };
 
-void RunServer(const std::string& server_address, const std::string& base_directory);
+void RunServer(const std::string& server_address, const std::string& base_directory,
+               const AdmissionConfig& admission_config = AdmissionConfig());
 
 #endif // FILE_SERVER_H